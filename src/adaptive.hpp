@@ -0,0 +1,106 @@
+#pragma once
+#include "color.hpp"
+#include "math.hpp"
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Running estimate of a single pixel, the mean and variance of every channel are kept with Welford's algorithm
+struct PixelEstimate {
+	uint32_t count = 0;
+	float means[3] = { 0.0f, 0.0f, 0.0f };
+	float m2[3] = { 0.0f, 0.0f, 0.0f };
+
+	void add(Color color) {
+		count++;
+
+		const float values[3] = { color.red, color.green, color.blue };
+		for (int channel = 0; channel < 3; channel++) {
+			float delta = values[channel] - means[channel];
+			means[channel] += delta / float(count);
+			m2[channel] += delta * (values[channel] - means[channel]);
+		}
+	}
+
+	// Standard error of the mean of the noisiest channel, how far the current pixel value is expected to be off
+	// Per channel, so an edge between two colors of similar luminance still shows up as noise
+	float error() const {
+		if (count < 2) return INFINITY;
+
+		const float variance = max(m2[0], max(m2[1], m2[2])) / float(count - 1);
+		return sqrtf(variance / float(count));
+	}
+
+	Color mean() const {
+		return Color(means[0], means[1], means[2]);
+	}
+};
+
+// Per pixel estimates kept alongside the image
+class VarianceBuffer {
+  public:
+	int width = 0;
+	int height = 0;
+	std::vector<PixelEstimate> pixels;
+
+	void reset(int width, int height) {
+		this->width = width;
+		this->height = height;
+
+		// Keeps the capacity, so this only allocates when the viewport grows
+		pixels.assign(size_t(width) * size_t(height), PixelEstimate());
+	}
+
+	PixelEstimate& at(int x, int y) {
+		return pixels[size_t(y) * size_t(width) + size_t(x)];
+	}
+
+	// Largest error over the pixel's 3x3 neighbourhood, ignoring neighbours that haven't been sampled yet
+	// A few samples that happen to agree say little about a pixel next to an edge, but its neighbours' do
+	float neighbourhoodError(int x, int y) {
+		float error = 0.0f;
+
+		for (int neighbourY = max(y - 1, 0); neighbourY <= min(y + 1, height - 1); neighbourY++) {
+			for (int neighbourX = max(x - 1, 0); neighbourX <= min(x + 1, width - 1); neighbourX++) {
+				const PixelEstimate& estimate = at(neighbourX, neighbourY);
+				if (estimate.count > 0) error = max(error, estimate.error());
+			}
+		}
+
+		return error;
+	}
+};
+
+// Screen region sampled and retired as a whole, end coordinates are exclusive
+struct Tile {
+	int startX;
+	int startY;
+	int endX;
+	int endY;
+};
+
+struct AdaptiveSamplingStats {
+	uint64_t raysTraced = 0;
+	uint64_t raysBudget = 0;
+	uint32_t tilesTotal = 0;
+	uint32_t tilesRetired = 0;
+
+	uint64_t raysSaved() const {
+		return raysBudget > raysTraced ? raysBudget - raysTraced : 0;
+	}
+
+	float savedRatio() const {
+		return raysBudget > 0 ? float(raysSaved()) / float(raysBudget) : 0.0f;
+	}
+};
+
+struct AdaptiveSamplingSettings {
+	bool isEnabled = true;
+	// Samples every pixel gets before its variance is trusted
+	int minSamples = 4;
+	// Samples added to each unconverged pixel per pass
+	int batchSamples = 4;
+	// Standard error, in linear space, below which a pixel and its neighbourhood are considered converged
+	float threshold = 0.004f;
+	int tileSize = 16;
+};
@@ -0,0 +1,24 @@
+#include "allocator.hpp"
+#include <cstdlib>
+
+namespace AllocationTracker {
+	std::atomic<uint64_t> hotPathAllocations(0);
+	thread_local int hotPathDepth = 0;
+} // namespace AllocationTracker
+
+#ifdef ENABLE_ALLOCATION_TRACKING
+// Replaces the global allocation functions, so every heap allocation made on the hot path gets counted
+// The array, nothrow and sized variants all forward to these by default
+void* operator new(size_t size) {
+	AllocationTracker::onAllocation();
+
+	void* pointer = std::malloc(size > 0 ? size : 1);
+	if (pointer == nullptr) throw std::bad_alloc();
+
+	return pointer;
+}
+
+void operator delete(void* pointer) noexcept {
+	std::free(pointer);
+}
+#endif
@@ -0,0 +1,179 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Heap allocations made inside a HotPathScope are only counted when ENABLE_ALLOCATION_TRACKING is defined,
+// which CMake does for Debug builds, see allocator.cpp
+
+namespace AllocationTracker {
+	// Allocations made by any thread while inside a HotPathScope
+	extern std::atomic<uint64_t> hotPathAllocations;
+	extern thread_local int hotPathDepth;
+
+	inline uint64_t count() {
+		return hotPathAllocations.load(std::memory_order_relaxed);
+	}
+
+	inline void onAllocation() {
+		if (hotPathDepth > 0) hotPathAllocations.fetch_add(1, std::memory_order_relaxed);
+	}
+} // namespace AllocationTracker
+
+// Marks the current thread as being on the render hot path, where no heap allocations are expected
+class HotPathScope {
+  public:
+#ifdef ENABLE_ALLOCATION_TRACKING
+	HotPathScope() {
+		AllocationTracker::hotPathDepth++;
+	}
+
+	~HotPathScope() {
+		AllocationTracker::hotPathDepth--;
+	}
+#else
+	HotPathScope() { }
+#endif
+
+	HotPathScope(const HotPathScope&) = delete;
+	HotPathScope& operator=(const HotPathScope&) = delete;
+};
+
+// Bump allocator for per-frame temporaries, everything is released at once by reset()
+// The blocks are kept between frames, so once it has warmed up it never touches the heap again
+class Arena {
+  public:
+	static constexpr size_t defaultBlockSize = 256 * 1024;
+
+	explicit Arena(size_t blockSize = defaultBlockSize) : blockSize(blockSize) { }
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+		// Try to fit it in the current block, then in the following already allocated ones
+		while (currentBlock < blocks.size()) {
+			Block& block = blocks[currentBlock];
+
+			// Align the address itself, the block is only aligned for max_align_t
+			const uintptr_t base = uintptr_t(block.data.get());
+			const size_t offset = ((base + currentOffset + alignment - 1) & ~uintptr_t(alignment - 1)) - base;
+
+			if (offset + size <= block.size) {
+				currentOffset = offset + size;
+				bytesUsed += size;
+
+				return block.data.get() + offset;
+			}
+
+			currentBlock++;
+			currentOffset = 0;
+		}
+
+		// Out of space, grow by one block large enough for this allocation
+		size_t newBlockSize = size + alignment > blockSize ? size + alignment : blockSize;
+		blocks.push_back(Block { std::unique_ptr<uint8_t[]>(new uint8_t[newBlockSize]), newBlockSize });
+		capacity += newBlockSize;
+
+		return allocate(size, alignment);
+	}
+
+	template <class T>
+	T* allocate(size_t count) {
+		return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+	}
+
+	void reset() {
+		currentBlock = 0;
+		currentOffset = 0;
+		bytesUsed = 0;
+	}
+
+	size_t used() const {
+		return bytesUsed;
+	}
+
+	size_t reserved() const {
+		return capacity;
+	}
+
+  private:
+	struct Block {
+		std::unique_ptr<uint8_t[]> data;
+		size_t size;
+	};
+
+	size_t blockSize;
+	std::vector<Block> blocks;
+	size_t currentBlock = 0;
+	size_t currentOffset = 0;
+	size_t bytesUsed = 0;
+	size_t capacity = 0;
+};
+
+// Fixed size slot allocator for long-lived objects, freed slots are recycled through a free list
+// Objects still alive when the pool dies are not destroyed, only their memory is released
+template <class T, size_t SlotsPerChunk = 64>
+class Pool {
+	// Chunks come from plain new, which only guarantees max_align_t alignment in C++11
+	static_assert(alignof(T) <= alignof(std::max_align_t), "Pool does not support over-aligned types");
+
+  public:
+	Pool() { }
+
+	Pool(const Pool&) = delete;
+	Pool& operator=(const Pool&) = delete;
+
+	template <class... Args>
+	T* create(Args&&... args) {
+		if (freeList == nullptr) grow();
+
+		Slot* slot = freeList;
+		freeList = slot->next;
+		liveCount++;
+
+		return new (slot->storage) T(std::forward<Args>(args)...);
+	}
+
+	void destroy(T* object) {
+		if (object == nullptr) return;
+		object->~T();
+
+		Slot* slot = reinterpret_cast<Slot*>(object);
+		slot->next = freeList;
+		freeList = slot;
+		liveCount--;
+	}
+
+	size_t size() const {
+		return liveCount;
+	}
+
+	size_t capacity() const {
+		return chunks.size() * SlotsPerChunk;
+	}
+
+  private:
+	union Slot {
+		Slot* next;
+		alignas(T) unsigned char storage[sizeof(T)];
+	};
+
+	std::vector<std::unique_ptr<Slot[]>> chunks;
+	Slot* freeList = nullptr;
+	size_t liveCount = 0;
+
+	void grow() {
+		Slot* chunk = new Slot[SlotsPerChunk];
+		chunks.push_back(std::unique_ptr<Slot[]>(chunk));
+
+		for (size_t i = 0; i < SlotsPerChunk; i++) {
+			chunk[i].next = freeList;
+			freeList = &chunk[i];
+		}
+	}
+};
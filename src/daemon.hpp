@@ -0,0 +1,308 @@
+#pragma once
+#include "engine.hpp"
+#include "scene_cache.hpp"
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+// A single render request, parsed from a line of space separated key=value pairs:
+//   scene=<default|path> width=<pixels> height=<pixels> samples=<count> camera=<x>,<y>,<z>
+// Every key is optional
+struct RenderJob {
+	// Bounds a single job's memory, the variance buffer alone takes 24 bytes per pixel
+	static constexpr int64_t maxPixels = 4096 * 2048;
+	static constexpr int maxAxis = 8192;
+	static constexpr int maxSamples = 1024;
+	// Bounds a single job's work, the daemon serves one job at a time so a huge one would block every client
+	// At roughly a microsecond per ray this is a couple of minutes, a 1080p frame at 64 samples per pixel
+	static constexpr int64_t maxRays = int64_t(1920) * 1080 * 64;
+
+	std::string scene = "default";
+	Size size = Size(800, 450);
+	uint32_t samples = 1;
+	bool hasCamera = false;
+	Vector3 camera;
+
+	bool parse(const std::string& line, std::string& error) {
+		std::istringstream stream(line);
+		std::string token;
+
+		while (stream >> token) {
+			size_t separator = token.find('=');
+			if (separator == std::string::npos) {
+				error = "Expected key=value, got '" + token + "'";
+				return false;
+			}
+
+			std::string key = token.substr(0, separator);
+			std::string value = token.substr(separator + 1);
+
+			if (key == "scene") {
+				scene = value;
+			} else if (key == "width") {
+				size.width = atoi(value.c_str());
+			} else if (key == "height") {
+				size.height = atoi(value.c_str());
+			} else if (key == "samples") {
+				int count = atoi(value.c_str());
+				if (count < 1 || count > maxSamples) {
+					error = "Samples must be between 1 and " + std::to_string(maxSamples);
+					return false;
+				}
+				samples = uint32_t(count);
+			} else if (key == "camera") {
+				if (sscanf(value.c_str(), "%f,%f,%f", &camera.x, &camera.y, &camera.z) != 3) {
+					error = "Expected camera=<x>,<y>,<z>";
+					return false;
+				}
+				hasCamera = true;
+			} else {
+				error = "Unknown key '" + key + "'";
+				return false;
+			}
+		}
+
+		if (size.width <= 0 || size.height <= 0 || size.width > maxAxis || size.height > maxAxis) {
+			error = "Resolution must be between 1 and " + std::to_string(maxAxis) + " on each axis";
+			return false;
+		}
+
+		if (int64_t(size.width) * int64_t(size.height) > maxPixels) {
+			error = "Resolution must not exceed " + std::to_string(maxPixels) + " pixels";
+			return false;
+		}
+
+		if (int64_t(size.width) * int64_t(size.height) * int64_t(samples) > maxRays) {
+			error = "Pixels times samples must not exceed " + std::to_string(maxRays) + " rays";
+			return false;
+		}
+
+		return true;
+	}
+};
+
+// Long-lived render server listening on a local Unix socket
+// Scenes stay loaded between jobs, so the per-job latency is just the trace time
+// Each request line is answered with "OK <bytes>\n" followed by a PPM (P6) image, or with "ERROR <message>\n"
+// Connections are served one at a time and closed after being idle for a few seconds
+// Sending "shutdown" stops the daemon
+class RenderDaemon {
+  public:
+	RenderDaemon(Engine& engine, size_t cacheCapacity = 8) : engine(engine), scenes(cacheCapacity) { }
+
+	~RenderDaemon() {
+		if (server >= 0) close(server);
+		if (!socketPath.empty()) unlink(socketPath.c_str());
+	}
+
+	int run(const char* path) {
+		// A client hanging up mid-response should fail the write, not kill the daemon
+		signal(SIGPIPE, SIG_IGN);
+
+		sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (strlen(path) >= sizeof(address.sun_path)) {
+			std::cout << "Socket path is too long: " << path << std::endl;
+			return -1;
+		}
+		strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+		server = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (server < 0) {
+			perror("Could not create socket");
+			return -1;
+		}
+
+		// Remove a stale socket left behind by a previous run, but never anything that isn't a socket, nor a
+		// socket another daemon is still listening on
+		struct stat existing;
+		if (lstat(path, &existing) == 0) {
+			if (!S_ISSOCK(existing.st_mode)) {
+				std::cout << "Refusing to replace " << path << ", it exists and is not a socket" << std::endl;
+				return -1;
+			}
+
+			int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (probe < 0) {
+				perror("Could not create socket");
+				return -1;
+			}
+			bool isStale = connect(probe, (sockaddr*)&address, sizeof(address)) < 0 && errno == ECONNREFUSED;
+			close(probe);
+
+			if (!isStale) {
+				std::cout << "Refusing to replace " << path << ", another daemon may still be listening on it"
+						  << std::endl;
+				return -1;
+			}
+			unlink(path);
+		}
+
+		if (bind(server, (sockaddr*)&address, sizeof(address)) < 0) {
+			perror("Could not bind socket");
+			return -1;
+		}
+		socketPath = path;
+
+		if (listen(server, 16) < 0) {
+			perror("Could not listen on socket");
+			return -1;
+		}
+
+		std::cout << "Render daemon listening on " << path << std::endl;
+
+		while (engine.isRunning) {
+			int client = accept(server, nullptr, nullptr);
+			if (client < 0) continue;
+
+			serve(client);
+			close(client);
+		}
+
+		return 0;
+	}
+
+  private:
+	static constexpr size_t maxRequestLength = 4096;
+	static constexpr int connectionTimeoutSeconds = 5;
+
+	Engine& engine;
+	SceneCache scenes;
+	int server = -1;
+	std::string socketPath;
+
+	// Handles the requests sent through a connection, until the client hangs up or stays idle for too long
+	// Only one connection is served at a time, so the timeout keeps an idle client from starving the rest
+	void serve(int client) {
+		timeval timeout;
+		timeout.tv_sec = connectionTimeoutSeconds;
+		timeout.tv_usec = 0;
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		LineReader reader(client);
+		std::string line;
+		while (true) {
+			LineReader::Status status = reader.read(line);
+			if (status == LineReader::Closed) return;
+			if (status == LineReader::TooLong) {
+				std::string response = "ERROR Request is longer than " + std::to_string(maxRequestLength) + " bytes\n";
+				writeAll(client, response.data(), response.size());
+				return;
+			}
+
+			if (line == "shutdown") {
+				engine.isRunning = false;
+				return;
+			}
+
+			std::string error;
+			std::vector<uint8_t> image;
+			if (!render(line, image, error)) {
+				std::string response = "ERROR " + error + "\n";
+				if (!writeAll(client, response.data(), response.size())) return;
+				continue;
+			}
+
+			std::string header = "OK " + std::to_string(image.size()) + "\n";
+			if (!writeAll(client, header.data(), header.size())) return;
+			if (!writeAll(client, image.data(), image.size())) return;
+		}
+	}
+
+	bool render(const std::string& request, std::vector<uint8_t>& image, std::string& error) {
+		uint64_t startTime = SDL_GetPerformanceCounter();
+
+		RenderJob job;
+		job.samples = engine.sampler.samplesPerPixel;
+		if (!job.parse(request, error)) return false;
+
+		uint64_t misses = scenes.misses;
+		World* scene = scenes.acquire(job.scene);
+		if (scene == nullptr) {
+			error = "Could not load scene '" + job.scene + "'";
+			return false;
+		}
+		bool isCacheHit = misses == scenes.misses;
+
+		// Jobs only override the camera and sample count for their own duration
+		Camera camera = scene->camera;
+		uint32_t samplesPerPixel = engine.sampler.samplesPerPixel;
+		if (job.hasCamera) scene->camera.origin = job.camera;
+		engine.sampler.samplesPerPixel = job.samples;
+
+		image = engine.renderImage(*scene, job.size);
+
+		scene->camera = camera;
+		engine.sampler.samplesPerPixel = samplesPerPixel;
+
+		TextureCacheStats textureStats = engine.textureCache.stats();
+		double duration = (SDL_GetPerformanceCounter() - startTime) * 1000 / (double)SDL_GetPerformanceFrequency();
+		std::cout << "Job " << job.scene << " " << job.size.width << "x" << job.size.height << ": " << duration
+				  << " ms (trace " << engine.getLastFrameDuration() << " ms, scene cache "
+				  << (isCacheHit ? "hit" : "miss") << ", texture cache " << textureStats.hitRate() * 100.0f
+				  << "% hits, " << textureStats.residentBytes / 1024 << " KB resident)" << std::endl;
+
+		return true;
+	}
+
+	// Buffered reader splitting a connection into request lines, bounded by maxRequestLength
+	class LineReader {
+	  public:
+		enum Status { Line, Closed, TooLong };
+
+		explicit LineReader(int fd) : fd(fd) { }
+
+		Status read(std::string& line) {
+			line.clear();
+
+			while (true) {
+				// Consume what is already buffered, up to the next line break
+				while (start < end) {
+					char character = buffer[start++];
+					if (character == '\n') return Line;
+					if (character == '\r') continue;
+					if (line.size() >= maxRequestLength) return TooLong;
+					line += character;
+				}
+
+				// Also fails once the receive timeout expires, which drops the idle client
+				ssize_t count = ::read(fd, buffer, sizeof(buffer));
+				if (count <= 0) return line.empty() ? Closed : Line;
+
+				start = 0;
+				end = size_t(count);
+			}
+		}
+
+	  private:
+		int fd;
+		char buffer[4096];
+		size_t start = 0;
+		size_t end = 0;
+	};
+
+	static bool writeAll(int fd, const void* data, size_t size) {
+		const uint8_t* pointer = (const uint8_t*)data;
+
+		while (size > 0) {
+			ssize_t count = write(fd, pointer, size);
+			if (count <= 0) return false;
+
+			pointer += count;
+			size -= size_t(count);
+		}
+
+		return true;
+	}
+};
@@ -1,11 +1,17 @@
 #pragma once
+#include "adaptive.hpp"
+#include "allocator.hpp"
 #include "color.hpp"
 #include "math.hpp"
 #include "ray.hpp"
+#include "sampler.hpp"
 #include "vector.hpp"
 #include "world.hpp"
 #include <SDL2/SDL.h>
+#include <fstream>
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include "../bindings/imgui_impl_sdl.h"
 #include "../bindings/imgui_impl_sdlrenderer.h"
@@ -38,11 +44,15 @@ class Engine {
 
 	// Flags
 	bool isGammaCorrectionEnabled = true;
+	float gamma = 2.2f;
 	bool isMouseMovingLight = false;
 	bool isMouseMovingCamera = false;
 	bool isRunning = true;
 
 	World world;
+	TextureCache textureCache;
+	Sampler sampler = Sampler(SamplerType::Sobol, 1);
+	AdaptiveSamplingSettings adaptiveSampling;
 
   private:
 	// SDL
@@ -64,14 +74,28 @@ class Engine {
 	Size virtualViewport = viewport;
 	float aspectRatio = float(viewport.width) / float(viewport.height);
 
+	// Sampling
+	VarianceBuffer varianceBuffer;
+	AdaptiveSamplingStats adaptiveStats;
+
+	// Scene being rendered, only differs from world while rendering an external scene
+	World* activeWorld = &world;
+
+	// Memory
+	// Per-frame temporaries, a single arena since frames are rendered on one thread
+	Arena frameArena;
+	uint64_t hotPathAllocations = 0;
+
   public:
 	Engine() { }
 
 	~Engine() {
-		// Free ImGui resources
-		ImGui_ImplSDL2_Shutdown();
-		ImGui_ImplSDLRenderer_Shutdown();
-		ImGui::DestroyContext();
+		// Free ImGui resources, unless running headless where it was never created
+		if (ImGui::GetCurrentContext() != nullptr) {
+			ImGui_ImplSDL2_Shutdown();
+			ImGui_ImplSDLRenderer_Shutdown();
+			ImGui::DestroyContext();
+		}
 
 		// Free SDL resources
 		SDL_DestroyTexture(frameBuffer);
@@ -149,6 +173,71 @@ class Engine {
 		}
 	}
 
+	// Renders a single frame of the given scene into a PPM image, without a window
+	std::vector<uint8_t> renderImage(World& scene, Size size) {
+		virtualViewport = size;
+		aspectRatio = float(size.width) / float(size.height);
+
+		// Render into a plain buffer instead of the SDL texture
+		std::vector<uint8_t> buffer(size_t(virtualViewport.width) * size_t(virtualViewport.height) * 4);
+		pixels = buffer.data();
+		pitch = virtualViewport.width * 4;
+		activeWorld = &scene;
+
+		uint64_t startTime = SDL_GetPerformanceCounter();
+		frameArena.reset();
+		onRender();
+		lastFrameDuration = (SDL_GetPerformanceCounter() - startTime) * 1000 / (double)SDL_GetPerformanceFrequency();
+
+		std::vector<uint8_t> image = encodeFrame();
+		activeWorld = &world;
+		pixels = nullptr;
+
+		return image;
+	}
+
+	// Renders a single frame without a window, writes it to a PPM file and prints the stats
+	int renderHeadless(const char* outputPath) {
+		std::vector<uint8_t> image = renderImage(world, viewport);
+
+		std::ofstream file(outputPath, std::ios::binary);
+		if (!file) {
+			std::cout << "Could not open " << outputPath << " for writing!" << std::endl;
+			return -1;
+		}
+
+		file.write((const char*)image.data(), image.size());
+
+		std::cout << "Rendered " << virtualViewport.width << "x" << virtualViewport.height << " to " << outputPath
+				  << " in " << lastFrameDuration << " ms" << std::endl;
+		printStats();
+
+		return 0;
+	}
+
+	void printStats() {
+		std::cout << "Sampler: " << Sampler::name(sampler.type) << ", " << sampler.samplesPerPixel
+				  << " samples per pixel" << std::endl;
+		std::cout << "Rays traced: " << adaptiveStats.raysTraced << " / " << adaptiveStats.raysBudget << " ("
+				  << adaptiveStats.savedRatio() * 100.0f << "% saved)" << std::endl;
+		std::cout << "Tiles retired early: " << adaptiveStats.tilesRetired << " / " << adaptiveStats.tilesTotal
+				  << std::endl;
+#ifdef ENABLE_ALLOCATION_TRACKING
+		std::cout << "Hot path allocations: " << hotPathAllocations << std::endl;
+#else
+		std::cout << "Hot path allocations: not tracked (release build)" << std::endl;
+#endif
+
+		TextureCacheStats textureStats = textureCache.stats();
+		std::cout << "Texture cache: " << textureStats.hitRate() * 100.0f << "% hit rate, "
+				  << textureStats.residentBytes / 1024 << " / " << textureStats.budgetBytes / 1024 << " KB resident, "
+				  << textureStats.evictions << " evictions" << std::endl;
+	}
+
+	double getLastFrameDuration() const {
+		return lastFrameDuration;
+	}
+
   private:
 	int createWindow() {
 		// Define the window flags
@@ -351,6 +440,9 @@ class Engine {
 	}
 
 	void onFrame() {
+		// Release last frame's temporaries
+		frameArena.reset();
+
 		// Lock the texture and acquire the pixel data
 		SDL_LockTexture(frameBuffer, nullptr, &pixels, &pitch);
 
@@ -423,6 +515,20 @@ class Engine {
 			ImGui::Checkbox("Mouse move light", &isMouseMovingLight);
 			ImGui::Checkbox("Mouse move camera", &isMouseMovingCamera);
 			ImGui::Separator();
+			onRenderSamplerOverlay();
+			ImGui::Separator();
+			onRenderAdaptiveSamplingOverlay();
+			ImGui::Separator();
+#ifdef ENABLE_ALLOCATION_TRACKING
+			ImGui::Text("Hot path allocations: %llu", (unsigned long long)hotPathAllocations);
+#else
+			ImGui::Text("Hot path allocations: not tracked (release build)");
+#endif
+			ImGui::Text(
+				"Frame arena: %.1f / %.1f KB", frameArena.used() / 1024.0f, frameArena.reserved() / 1024.0f
+			);
+			onRenderTextureCacheOverlay();
+			ImGui::Separator();
 
 			if (ImGui::IsMousePosValid()) ImGui::Text("Mouse Position: (%.1f, %.1f)", io.MousePos.x, io.MousePos.y);
 
@@ -430,64 +536,233 @@ class Engine {
 		}
 	}
 
+	void onRenderSamplerOverlay() {
+		const char* samplerTypes[] = { Sampler::name(SamplerType::Random),
+									   Sampler::name(SamplerType::Stratified),
+									   Sampler::name(SamplerType::Sobol),
+									   Sampler::name(SamplerType::BlueNoise) };
+
+		int samplerType = int(sampler.type);
+		if (ImGui::Combo("Sampler", &samplerType, samplerTypes, 4)) sampler.type = SamplerType(samplerType);
+
+		int samplesPerPixel = int(sampler.samplesPerPixel);
+		if (ImGui::SliderInt("Samples per pixel", &samplesPerPixel, 1, 64)) sampler.samplesPerPixel = samplesPerPixel;
+	}
+
+	void onRenderAdaptiveSamplingOverlay() {
+		ImGui::Checkbox("Adaptive sampling", &adaptiveSampling.isEnabled);
+		ImGui::SliderFloat("Error threshold", &adaptiveSampling.threshold, 0.0005f, 0.05f, "%.4f");
+		ImGui::Text(
+			"Rays: %llu / %llu (%.1f%% saved)",
+			(unsigned long long)adaptiveStats.raysTraced,
+			(unsigned long long)adaptiveStats.raysBudget,
+			adaptiveStats.savedRatio() * 100.0f
+		);
+		ImGui::Text("Tiles retired early: %u / %u", adaptiveStats.tilesRetired, adaptiveStats.tilesTotal);
+	}
+
+	void onRenderTextureCacheOverlay() {
+		TextureCacheStats stats = textureCache.stats();
+		ImGui::Text("Texture cache hit rate: %.1f%%", stats.hitRate() * 100.0f);
+		ImGui::Text(
+			"Texture cache: %.1f / %.1f MB",
+			stats.residentBytes / (1024.0f * 1024.0f),
+			stats.budgetBytes / (1024.0f * 1024.0f)
+		);
+	}
+
 	void onRender() {
+		// Anything allocated from here on should come from the frame arena
+		HotPathScope hotPath;
+		const uint64_t allocationsBefore = AllocationTracker::count();
+
+		adaptiveStats = AdaptiveSamplingStats();
+		varianceBuffer.reset(virtualViewport.width, virtualViewport.height);
+
+		// Split the image into tiles, so converged regions can be retired as a whole
+		const int tileSize = max(adaptiveSampling.tileSize, 1);
+		const int tilesX = (virtualViewport.width + tileSize - 1) / tileSize;
+		const int tilesY = (virtualViewport.height + tileSize - 1) / tileSize;
+		const int tileCount = tilesX * tilesY;
+
+		Tile* tiles = frameArena.allocate<Tile>(tileCount);
+		for (int i = 0; i < tileCount; i++) {
+			const int tileX = (i % tilesX) * tileSize, tileY = (i / tilesX) * tileSize;
+			tiles[i] = Tile { tileX,
+							  tileY,
+							  min(tileX + tileSize, virtualViewport.width),
+							  min(tileY + tileSize, virtualViewport.height) };
+		}
+
+		for (int i = 0; i < tileCount; i++) renderTile(tiles[i]);
+
+		// Resolve the estimates into the frame buffer
 		for (int y = 0; y < virtualViewport.height; y++) {
 			for (int x = 0; x < virtualViewport.width; x++) {
-				// Calculate the UV coordinates [0.0 to 1.0]
-				float u = (float(x) / float(virtualViewport.width)) * 2.0f - 1.0f;
-				float v = (float(y) / float(virtualViewport.height)) * 2.0f - 1.0f;
+				Color color = varianceBuffer.at(x, y).mean();
 
-				// Maintain the aspect ratio
-				u *= aspectRatio;
+				// Applies gamma correction, once per pixel, after the samples were averaged in linear space
+				if (isGammaCorrectionEnabled) color = Color::pow(color, 1.0f / gamma);
 
-				// Create the
-				Ray ray(world.camera.origin, Vector3(u, v, -1.0f));
+				setPixel(x, y, color);
+			}
+		}
 
-				bool hasHitAnObject = false;
-				for (Sphere sphere : world.spheres) {
-					Vector3 center = ray.origin - sphere.position;
+		hotPathAllocations = AllocationTracker::count() - allocationsBefore;
+	}
 
-					float a = Vector3::dot(ray.direction, ray.direction);
-					float b = 2.0f * Vector3::dot(center, ray.direction);
-					float c = Vector3::dot(center, ray.origin) - sphere.radius * sphere.radius;
-					float discriminant = b * b - 4 * a * c;
+	void renderTile(const Tile& tile) {
+		const int startX = tile.startX, startY = tile.startY, endX = tile.endX, endY = tile.endY;
+		const uint32_t maxSamples = max(sampler.samplesPerPixel, 1u);
+		const uint32_t minSamples =
+			adaptiveSampling.isEnabled ? min(uint32_t(max(adaptiveSampling.minSamples, 2)), maxSamples) : maxSamples;
+		const uint32_t batchSamples = uint32_t(max(adaptiveSampling.batchSamples, 1));
 
-					if (discriminant >= 0) {
-						float t = (-b - sqrtf(discriminant)) / (2.0f * a);
+		adaptiveStats.tilesTotal++;
+		adaptiveStats.raysBudget += uint64_t(endX - startX) * uint64_t(endY - startY) * maxSamples;
 
-						// Calculate the hit position and hit surface normal
-						Vector3 hitPosition = ray.origin + ray.direction * t;
-						Vector3 normal = Vector3::normalize(hitPosition /*  - sphere.position */);
+		// Every pixel gets the minimum amount of samples, so its variance can be estimated
+		for (int y = startY; y < endY; y++) {
+			for (int x = startX; x < endX; x++) samplePixel(x, y, minSamples);
+		}
 
-						// Calculate basic normal shading
-						float light = max(Vector3::dot(normal, -world.light), 0.0f);
-						Color color = sphere.color * light;
+		// Keep refining the pixels whose neighbourhood is above the threshold, until all of them converge or the
+		// budget runs out
+		uint32_t passSamples = minSamples;
+		while (passSamples < maxSamples) {
+			const uint32_t count = min(batchSamples, maxSamples - passSamples);
 
-						// Applies gamma correction
-						if (isGammaCorrectionEnabled) {
-							float gamma = 2.2f;
-							color = Color::pow(color, 1.0f / gamma);
-						}
+			bool hasRefined = false;
+			for (int y = startY; y < endY; y++) {
+				for (int x = startX; x < endX; x++) {
+					if (varianceBuffer.neighbourhoodError(x, y) <= adaptiveSampling.threshold) continue;
 
-						// Set the pixel
-						setPixel(x, y, color);
+					samplePixel(x, y, count);
+					hasRefined = true;
+				}
+			}
 
-						// Notify that one object was hit
-						hasHitAnObject = true;
+			if (!hasRefined) break;
+			passSamples += count;
+		}
 
-						// Already hit one sphere, breaks the for-loop
-						break;
-					}
-				}
+		if (passSamples < maxSamples) adaptiveStats.tilesRetired++;
+	}
 
-				// If none object was hit, paint a sky gradient
-				if (!hasHitAnObject) {
-					float gradient = v * 1.3;
-					Color color = Color::mix(Color(0.5f, 0.7f, 1.0f), Color(1.0, 1.0, 1.0), gradient);
-					setPixel(x, y, color);
-				}
+	void samplePixel(int x, int y, uint32_t count) {
+		PixelEstimate& estimate = varianceBuffer.at(x, y);
+
+		for (uint32_t i = 0; i < count; i++) {
+			// Continue the pixel's sequence where it left off, dimensions 0 and 1 jitter the ray inside the pixel
+			const uint32_t sample = estimate.count;
+			float offsetX = sampler.sample(x, y, sample, 0);
+			float offsetY = sampler.sample(x, y, sample, 1);
+
+			estimate.add(trace(float(x) + offsetX, float(y) + offsetY));
+		}
+
+		adaptiveStats.raysTraced += count;
+	}
+
+	Color trace(float x, float y) {
+		// Calculate the UV coordinates [0.0 to 1.0]
+		float u = (x / float(virtualViewport.width)) * 2.0f - 1.0f;
+		float v = (y / float(virtualViewport.height)) * 2.0f - 1.0f;
+
+		// Maintain the aspect ratio
+		u *= aspectRatio;
+
+		World& scene = *activeWorld;
+
+		// Create the
+		Ray ray(scene.camera.origin, Vector3(u, v, -1.0f));
+
+		for (Sphere& sphere : scene.spheres) {
+			Vector3 center = ray.origin - sphere.position;
+
+			float a = Vector3::dot(ray.direction, ray.direction);
+			float b = 2.0f * Vector3::dot(center, ray.direction);
+			float c = Vector3::dot(center, ray.origin) - sphere.radius * sphere.radius;
+			float discriminant = b * b - 4 * a * c;
+
+			if (discriminant >= 0) {
+				float t = (-b - sqrtf(discriminant)) / (2.0f * a);
+
+				// Calculate the hit position and hit surface normal
+				Vector3 hitPosition = ray.origin + ray.direction * t;
+				Vector3 normal = Vector3::normalize(hitPosition /*  - sphere.position */);
+
+				// Calculate basic normal shading
+				float light = max(Vector3::dot(normal, -scene.light), 0.0f);
+				Color albedo = sphere.texture ? sampleTexture(sphere, ray, hitPosition) : sphere.color;
+				// Stays in linear space, gamma is only applied when the pixel is resolved
+				Color color = albedo * light;
+
+				// Already hit one sphere, no need to test the others
+				return color;
 			}
 		}
+
+		// If none object was hit, paint a sky gradient
+		// The gradient is authored in display space, so bring it to linear space like any other sample
+		float gradient = v * 1.3;
+		Color sky = Color::mix(Color(0.5f, 0.7f, 1.0f), Color(1.0, 1.0, 1.0), gradient);
+		return isGammaCorrectionEnabled ? Color::pow(sky, gamma) : sky;
+	}
+
+	// Looks the surface color up in the sphere's texture, picking the mip level from the ray differentials
+	Color sampleTexture(Sphere& sphere, Ray& ray, Vector3 hitPosition) {
+		// Directions of the rays through the next pixel to the right and the next one below
+		Vector3 directionX = ray.direction + Vector3(2.0f * aspectRatio / float(virtualViewport.width), 0.0f, 0.0f);
+		Vector3 directionY = ray.direction + Vector3(0.0f, 2.0f / float(virtualViewport.height), 0.0f);
+
+		// Intersect them with the tangent plane at the hit, the distance between the hits is the pixel footprint
+		Vector3 normal = Vector3::normalize(hitPosition - sphere.position);
+		float distance = Vector3::dot(hitPosition - ray.origin, normal);
+		float footprint = INFINITY;
+
+		float cosineX = Vector3::dot(directionX, normal), cosineY = Vector3::dot(directionY, normal);
+		if (fabsf(cosineX) > 1e-6f && fabsf(cosineY) > 1e-6f) {
+			Vector3 offsetX = ray.origin + directionX * (distance / cosineX) - hitPosition;
+			Vector3 offsetY = ray.origin + directionY * (distance / cosineY) - hitPosition;
+			footprint = max(offsetX.length(), offsetY.length()) * sphere.texelDensity(*sphere.texture);
+		}
+
+		Vector2 uv = sphere.uv(hitPosition);
+		Color albedo = textureCache.sample(*sphere.texture, uv.x, uv.y, footprint);
+
+		// The cache already returns linear values, without gamma correction everything stays in display space
+		if (!isGammaCorrectionEnabled) albedo = Color::pow(albedo, 1.0f / TiledTexture::gamma);
+
+		return albedo;
+	}
+
+	// Packs the current frame as a binary PPM (P6) image
+	std::vector<uint8_t> encodeFrame() {
+		constexpr int channels = 4;
+
+		std::string header = "P6\n" + std::to_string(virtualViewport.width) + " " +
+							 std::to_string(virtualViewport.height) + "\n255\n";
+		std::vector<uint8_t> image(header.begin(), header.end());
+		image.reserve(header.size() + size_t(virtualViewport.width) * size_t(virtualViewport.height) * 3);
+
+		const uint8_t* pointer = (const uint8_t*)pixels;
+		for (int i = 0; i < virtualViewport.width * virtualViewport.height; i++) {
+			const uint8_t* pixel = pointer + i * channels;
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+			// ARGB
+			image.push_back(pixel[1]);
+			image.push_back(pixel[2]);
+			image.push_back(pixel[3]);
+#else
+			// BGRA
+			image.push_back(pixel[2]);
+			image.push_back(pixel[1]);
+			image.push_back(pixel[0]);
+#endif
+		}
+
+		return image;
 	}
 
 	void setPixel(int x, int y, Color color) {
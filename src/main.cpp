@@ -1,7 +1,36 @@
+#include "daemon.hpp"
 #include "engine.hpp"
+#include <cstdlib>
+#include <cstring>
 
-int main() {
+int main(int argc, char* argv[]) {
     Engine engine;
+
+    // Usage: raytracer [--headless <output.ppm> | --daemon <socket>] [--samples <count>] [--texture-budget <MB>]
+    //        raytracer --convert-texture <input.ppm> <output.rtex>
+    const char* headlessOutput = nullptr;
+    const char* daemonSocket = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--convert-texture") == 0 && i + 2 < argc) {
+            return TiledTexture::convert(argv[i + 1], argv[i + 2]) ? 0 : -1;
+        } else if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc) {
+            engine.textureCache.setBudget(size_t(max(atoi(argv[++i]), 1)) * 1024 * 1024);
+        } else if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc) {
+            headlessOutput = argv[++i];
+        } else if (strcmp(argv[i], "--daemon") == 0 && i + 1 < argc) {
+            daemonSocket = argv[++i];
+        } else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+            engine.sampler.samplesPerPixel = max(atoi(argv[++i]), 1);
+        }
+    }
+
+    if (headlessOutput != nullptr) return engine.renderHeadless(headlessOutput);
+
+    if (daemonSocket != nullptr) {
+        RenderDaemon daemon(engine);
+        return daemon.run(daemonSocket);
+    }
+
     if (engine.init() < 0) return -1;
     engine.loop();
 
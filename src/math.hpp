@@ -1,10 +1,17 @@
 #pragma once
 
+constexpr float PI = 3.14159265358979323846f;
+
 template <class T>
 inline T max(T a, T b) {
     return a > b ? a : b;
 }
 
+template <class T>
+inline T min(T a, T b) {
+    return a < b ? a : b;
+}
+
 template <class T>
 inline T clamp(T value, T min, T max) {
     return (value > max ? max : (value < min ? min : value));
@@ -0,0 +1,232 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+
+enum class SamplerType { Random, Stratified, Sobol, BlueNoise };
+
+// Deterministic sample generator, every value is a pure function of (pixel, sample, dimension, seed)
+// This means no state is shared between callers, so any thread may sample any pixel in any order
+class Sampler {
+  public:
+	SamplerType type = SamplerType::Sobol;
+	uint32_t samplesPerPixel = 1;
+	uint32_t seed = 0;
+
+	Sampler() { }
+	Sampler(SamplerType type, uint32_t samplesPerPixel, uint32_t seed = 0)
+		: type(type), samplesPerPixel(samplesPerPixel), seed(seed) { }
+
+	// Returns a value in the range [0.0 to 1.0)
+	float sample(uint32_t x, uint32_t y, uint32_t sampleIndex, uint32_t dimension) const {
+		const uint32_t pixelSeed = hash(x, y, seed);
+
+		switch (type) {
+			case SamplerType::Stratified:
+				return sampleStratified(pixelSeed, sampleIndex, dimension);
+			case SamplerType::Sobol:
+				return sampleSobol(pixelSeed, sampleIndex, dimension);
+			case SamplerType::BlueNoise:
+				return sampleBlueNoise(x, y, sampleIndex, dimension);
+			case SamplerType::Random:
+			default:
+				return toFloat(hash(pixelSeed, sampleIndex, dimension));
+		}
+	}
+
+	static const char* name(SamplerType type) {
+		switch (type) {
+			case SamplerType::Random:
+				return "Random";
+			case SamplerType::Stratified:
+				return "Stratified";
+			case SamplerType::Sobol:
+				return "Sobol (Owen scrambled)";
+			case SamplerType::BlueNoise:
+				return "Blue noise";
+		}
+
+		return "Unknown";
+	}
+
+  private:
+	static constexpr uint32_t sobolDimensions = 4;
+
+#pragma region Sequences
+	// Latin hypercube, each dimension is split into N strata and shuffled independently
+	float sampleStratified(uint32_t pixelSeed, uint32_t sampleIndex, uint32_t dimension) const {
+		const uint32_t count = samplesPerPixel > 0 ? samplesPerPixel : 1;
+		const uint32_t index = sampleIndex % count;
+
+		const uint32_t stratum = permute(index, count, hash(pixelSeed, dimension, 0x5bd1e995u));
+		const float jitter = toFloat(hash(pixelSeed, index, dimension ^ 0x68e31da4u));
+
+		return clampUnit((float(stratum) + jitter) / float(count));
+	}
+
+	// Shuffled and scrambled Sobol, as described by Burley in "Practical Hash-based Owen Scrambling"
+	// Dimensions past the fourth are padded with decorrelated 4D sets instead of higher Sobol dimensions
+	float sampleSobol(uint32_t pixelSeed, uint32_t sampleIndex, uint32_t dimension) const {
+		const uint32_t set = dimension / sobolDimensions;
+		const uint32_t setSeed = hash(pixelSeed, set, 0x9e3779b9u);
+
+		const uint32_t index = nestedUniformScramble(sampleIndex, setSeed);
+		const uint32_t value = sobol(index, dimension % sobolDimensions);
+
+		return toFloat(nestedUniformScramble(value, hash(setSeed, dimension, 0x85ebca6bu)));
+	}
+
+	// Interleaved gradient noise gives a screen-space blue noise offset per pixel, which then rotates an R2
+	// sequence. The error is pushed into high frequencies the eye barely notices
+	// Dimensions are paired up, so the pixel jitter in dimensions 0 and 1 is a proper 2D low discrepancy set
+	float sampleBlueNoise(uint32_t x, uint32_t y, uint32_t sampleIndex, uint32_t dimension) const {
+		// Shift the pattern per dimension, so dimensions won't share the same offset
+		const uint32_t shift = hash(dimension, seed, 0xc2b2ae35u);
+		const float offsetX = float(x + (shift & 0xffu)), offsetY = float(y + ((shift >> 8) & 0xffu));
+		const float noise = fract(52.9829189f * fract(0.06711056f * offsetX + 0.00583715f * offsetY));
+
+		// Pairs past the first walk their points in a shuffled order, so they won't correlate with the first one
+		const uint32_t pair = dimension / 2;
+		uint32_t index = sampleIndex;
+		if (pair > 0 && samplesPerPixel > 1) {
+			const uint32_t count = samplesPerPixel, offset = sampleIndex % count;
+			index = sampleIndex - offset + permute(offset, count, hash(pair, seed, 0x27d4eb2fu));
+		}
+
+		// R2 sequence, stepping by the inverse powers of the plastic number (0.7548776662, 0.5698402910)
+		// Kept in 0.32 fixed point, so the sequence doesn't lose precision as the index grows
+		const uint32_t step = dimension % 2 == 0 ? 0xc13fa9a9u : 0x91e10da6u;
+		const float r2 = toFloat(index * step);
+
+		return clampUnit(fract(noise + r2));
+	}
+#pragma endregion Sequences
+
+#pragma region Sobol
+	struct SobolTable {
+		uint32_t directions[sobolDimensions][32];
+
+		SobolTable() {
+			// Primitive polynomial degree, coefficients and initial direction numbers from Joe & Kuo
+			const uint32_t degree[sobolDimensions] = { 0, 1, 2, 3 };
+			const uint32_t coefficients[sobolDimensions] = { 0, 0, 1, 1 };
+			const uint32_t initial[sobolDimensions][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 3, 0 }, { 1, 3, 1 } };
+
+			// First dimension is the Van der Corput sequence
+			for (uint32_t bit = 0; bit < 32; bit++) directions[0][bit] = 1u << (31 - bit);
+
+			for (uint32_t dimension = 1; dimension < sobolDimensions; dimension++) {
+				const uint32_t s = degree[dimension];
+				const uint32_t a = coefficients[dimension];
+				uint32_t* v = directions[dimension];
+
+				for (uint32_t bit = 0; bit < 32; bit++) {
+					if (bit < s) {
+						v[bit] = initial[dimension][bit] << (31 - bit);
+						continue;
+					}
+
+					v[bit] = v[bit - s] ^ (v[bit - s] >> s);
+					for (uint32_t k = 1; k < s; k++) v[bit] ^= ((a >> (s - 1 - k)) & 1u) * v[bit - k];
+				}
+			}
+		}
+	};
+
+	static uint32_t sobol(uint32_t index, uint32_t dimension) {
+		// Built once, initialization of function statics is thread safe since C++11
+		static const SobolTable table;
+
+		uint32_t result = 0;
+		for (uint32_t bit = 0; index != 0; bit++, index >>= 1) {
+			if (index & 1u) result ^= table.directions[dimension][bit];
+		}
+
+		return result;
+	}
+#pragma endregion Sobol
+
+#pragma region Hashing
+	static uint32_t hash(uint32_t a, uint32_t b, uint32_t c) {
+		// Combine the inputs, then run them through the lowbias32 finalizer
+		uint32_t h = a * 0x8da6b343u ^ b * 0xd8163841u ^ c * 0xcb1ab31fu;
+		h ^= h >> 16;
+		h *= 0x7feb352du;
+		h ^= h >> 15;
+		h *= 0x846ca68bu;
+		h ^= h >> 16;
+
+		return h;
+	}
+
+	static uint32_t reverseBits(uint32_t x) {
+		x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+		x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+		x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+		x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+
+		return (x >> 16) | (x << 16);
+	}
+
+	// Hash based Owen scrambling, each bit is only flipped based on the bits above it
+	static uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+		x = reverseBits(x);
+
+		x += seed;
+		x ^= x * 0x6c50b47cu;
+		x ^= x * 0xb82f1e52u;
+		x ^= x * 0xc7afe638u;
+		x ^= x * 0x8d22f6e6u;
+
+		return reverseBits(x);
+	}
+
+	// Kensler's hashed permutation, maps index into [0, length) without repetition for a given seed
+	static uint32_t permute(uint32_t index, uint32_t length, uint32_t seed) {
+		uint32_t mask = length - 1;
+		mask |= mask >> 1;
+		mask |= mask >> 2;
+		mask |= mask >> 4;
+		mask |= mask >> 8;
+		mask |= mask >> 16;
+
+		do {
+			index ^= seed;
+			index *= 0xe170893du;
+			index ^= seed >> 16;
+			index ^= (index & mask) >> 4;
+			index ^= seed >> 8;
+			index *= 0x0929eb3fu;
+			index ^= seed >> 23;
+			index ^= (index & mask) >> 1;
+			index *= 1 | seed >> 27;
+			index *= 0x6935fa69u;
+			index ^= (index & mask) >> 11;
+			index *= 0x74dcb303u;
+			index ^= (index & mask) >> 2;
+			index *= 0x9e501cc3u;
+			index ^= (index & mask) >> 2;
+			index *= 0xc860a3dfu;
+			index &= mask;
+			index ^= index >> 5;
+		} while (index >= length);
+
+		return (index + seed) % length;
+	}
+#pragma endregion Hashing
+
+#pragma region Helpers
+	static float toFloat(uint32_t value) {
+		// Use the upper 24 bits, which is all the precision a float holds
+		return float(value >> 8) * (1.0f / 16777216.0f);
+	}
+
+	static float fract(float value) {
+		return value - floorf(value);
+	}
+
+	static float clampUnit(float value) {
+		// 0x1.fffffep-1, the largest float below 1.0
+		return value < 0.99999994f ? value : 0.99999994f;
+	}
+#pragma endregion Helpers
+};
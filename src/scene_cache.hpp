@@ -0,0 +1,71 @@
+#pragma once
+#include "allocator.hpp"
+#include "world.hpp"
+#include <list>
+#include <string>
+#include <unordered_map>
+
+// Keeps the most recently used scenes loaded, so repeated jobs skip parsing and setup entirely
+// The scene named "default" is the built-in World, any other name is treated as a scene file path
+class SceneCache {
+  public:
+	size_t capacity;
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+
+	explicit SceneCache(size_t capacity = 8) : capacity(capacity > 0 ? capacity : 1) { }
+
+	SceneCache(const SceneCache&) = delete;
+	SceneCache& operator=(const SceneCache&) = delete;
+
+	~SceneCache() {
+		for (auto& entry : entries) worlds.destroy(entry.world);
+	}
+
+	// Returns the scene, loading it on a miss, or nullptr when it could not be loaded
+	World* acquire(const std::string& name) {
+		auto found = lookup.find(name);
+		if (found != lookup.end()) {
+			hits++;
+
+			// Move it to the front, as the most recently used
+			entries.splice(entries.begin(), entries, found->second);
+			return found->second->world;
+		}
+
+		misses++;
+
+		World* world = worlds.create();
+		if (name != "default" && !world->loadFromFile(name)) {
+			worlds.destroy(world);
+			return nullptr;
+		}
+
+		// Evict the least recently used scene to make room
+		if (entries.size() >= capacity) {
+			Entry& last = entries.back();
+			lookup.erase(last.name);
+			worlds.destroy(last.world);
+			entries.pop_back();
+		}
+
+		entries.push_front(Entry { name, world });
+		lookup[name] = entries.begin();
+
+		return world;
+	}
+
+	size_t size() const {
+		return entries.size();
+	}
+
+  private:
+	struct Entry {
+		std::string name;
+		World* world;
+	};
+
+	Pool<World, 8> worlds;
+	std::list<Entry> entries;
+	std::unordered_map<std::string, std::list<Entry>::iterator> lookup;
+};
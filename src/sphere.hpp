@@ -1,12 +1,33 @@
 #pragma once
 #include "vector.hpp"
 #include "color.hpp"
+#include "math.hpp"
+#include "texture.hpp"
+#include <memory>
 
 class Sphere {
   public:
 	Vector3 position;
 	float radius;
     Color color;
+    // Optional, replaces the flat color when present
+    std::shared_ptr<TiledTexture> texture;
 
 	Sphere(Vector3 position, float radius, Color color) : position(position), radius(radius), color(color) { }
+
+    // Equirectangular mapping of a point on the surface, U goes around the equator and V from top to bottom
+    Vector2 uv(Vector3 point) {
+        Vector3 direction = Vector3::normalize(point - position);
+
+        float u = 0.5f + atan2f(direction.z, direction.x) / (2.0f * PI);
+        float v = 0.5f - asinf(clamp(direction.y, -1.0f, 1.0f)) / PI;
+        return Vector2(u, v);
+    }
+
+    // How many texels of the given texture cover one world unit on the surface, taking the larger of both axes
+    float texelDensity(const TiledTexture& texture) {
+        float densityU = float(texture.width(0)) / (2.0f * PI * radius);
+        float densityV = float(texture.height(0)) / (PI * radius);
+        return max(densityU, densityV);
+    }
 };
\ No newline at end of file
@@ -0,0 +1,655 @@
+#pragma once
+#include "color.hpp"
+#include "math.hpp"
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// On-disk layout of a tiled, mip-mapped texture (.rtex), in native byte order:
+//   header: TextureHeader
+//   tile table: one uint64 file offset per tile, level by level, row by row
+//   tile data: tileSize * tileSize RGB8 texels per tile, edge tiles are padded by repeating their last texel
+// Texels are stored gamma encoded, they are decoded to linear space before any filtering
+struct TextureHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t tileSize;
+	uint32_t levels;
+};
+
+// Read-only handle to a .rtex file, tiles are only read on demand so the texture itself never sits in memory
+class TiledTexture {
+  public:
+	static constexpr uint32_t version = 1;
+	static constexpr uint32_t channels = 3;
+	// Keeps level and tile coordinates within the bits the cache reserves for them
+	static constexpr uint32_t maxSize = 1u << 20;
+	static constexpr uint32_t maxTileSize = 1024;
+	static constexpr float gamma = 2.2f;
+
+	// Never reused, so tiles cached for a destroyed texture can't be mistaken for another one's
+	const uint64_t id = nextId();
+
+	TiledTexture() { }
+
+	TiledTexture(const TiledTexture&) = delete;
+	TiledTexture& operator=(const TiledTexture&) = delete;
+
+	// Also drops the texture's tiles from every cache, defined after TextureCache
+	~TiledTexture();
+
+	// Rejects files whose header, tile table or tile offsets don't fit the file, so reads never go out of bounds
+	bool open(const std::string& path) {
+		fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+
+		struct stat file;
+		if (fstat(fd, &file) != 0) return false;
+		const uint64_t fileSize = uint64_t(file.st_size);
+
+		if (pread(fd, &header, sizeof(header), 0) != sizeof(header)) return false;
+		if (memcmp(header.magic, "RTEX", 4) != 0 || header.version != version) return false;
+		if (header.width == 0 || header.height == 0 || header.width > maxSize || header.height > maxSize) return false;
+		if (header.tileSize == 0 || header.tileSize > maxTileSize) return false;
+		if (header.levels == 0 || header.levels > 32) return false;
+
+		// Index the first tile of every level, so tiles can be addressed by (level, x, y)
+		uint64_t tileCount = 0;
+		for (uint32_t level = 0; level < header.levels; level++) {
+			levelFirstTile.push_back(tileCount);
+			tileCount += uint64_t(tilesX(level)) * tilesY(level);
+		}
+
+		const uint64_t tableSize = tileCount * sizeof(uint64_t);
+		if (sizeof(header) + tableSize > fileSize) return false;
+
+		offsets.resize(size_t(tileCount));
+		if (pread(fd, offsets.data(), size_t(tableSize), sizeof(header)) != ssize_t(tableSize)) return false;
+
+		for (uint64_t offset : offsets) {
+			if (offset < sizeof(header) + tableSize || offset > fileSize || fileSize - offset < tileBytes()) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	uint32_t levels() const {
+		return header.levels;
+	}
+
+	uint32_t tileSize() const {
+		return header.tileSize;
+	}
+
+	size_t tileBytes() const {
+		return size_t(header.tileSize) * header.tileSize * channels;
+	}
+
+	uint32_t width(uint32_t level) const {
+		return max(header.width >> level, 1u);
+	}
+
+	uint32_t height(uint32_t level) const {
+		return max(header.height >> level, 1u);
+	}
+
+	uint32_t tilesX(uint32_t level) const {
+		return (width(level) + header.tileSize - 1) / header.tileSize;
+	}
+
+	uint32_t tilesY(uint32_t level) const {
+		return (height(level) + header.tileSize - 1) / header.tileSize;
+	}
+
+	// Linear value of every 8 bit gamma encoded texel value
+	static const float* decodeTable() {
+		// Built once, initialization of function statics is thread safe since C++11
+		static const DecodeTable table;
+		return table.values;
+	}
+
+	static uint8_t encode(float linear) {
+		return uint8_t(clamp(powf(linear, 1.0f / gamma), 0.0f, 1.0f) * 255.0f + 0.5f);
+	}
+
+	// Safe to call from several threads at once, pread doesn't share a file position
+	bool readTile(uint32_t level, uint32_t tileX, uint32_t tileY, uint8_t* destination) const {
+		uint64_t offset = offsets[size_t(levelFirstTile[level] + uint64_t(tileY) * tilesX(level) + tileX)];
+		return pread(fd, destination, tileBytes(), off_t(offset)) == ssize_t(tileBytes());
+	}
+
+	// Converts a binary PPM (P6) image into a tiled, mip-mapped texture
+	static bool convert(const std::string& inputPath, const std::string& outputPath, uint32_t tileSize = 64) {
+		uint32_t width = 0, height = 0;
+		std::vector<uint8_t> image;
+		if (!readPPM(inputPath, width, height, image)) {
+			std::cout << "Could not read " << inputPath << ", expected a complete binary PPM (P6) with 8 bits per "
+					  << "channel and at most " << maxSize << " texels per side" << std::endl;
+			return false;
+		}
+
+		// Build the mip chain with a box filter, down to a single texel
+		// Averaging happens in linear space, each level is only encoded back once it is stored
+		const float* decode = decodeTable();
+		std::vector<float> linear(image.size());
+		for (size_t i = 0; i < image.size(); i++) linear[i] = decode[image[i]];
+
+		std::vector<std::vector<uint8_t>> mips;
+		mips.push_back(image);
+		uint32_t levelWidth = width, levelHeight = height;
+		while (levelWidth > 1 || levelHeight > 1) {
+			linear = downsample(linear, levelWidth, levelHeight);
+			levelWidth = max(levelWidth / 2, 1u);
+			levelHeight = max(levelHeight / 2, 1u);
+
+			std::vector<uint8_t> level(linear.size());
+			for (size_t i = 0; i < linear.size(); i++) level[i] = encode(linear[i]);
+			mips.push_back(level);
+		}
+
+		TextureHeader header;
+		memcpy(header.magic, "RTEX", 4);
+		header.version = version;
+		header.width = width;
+		header.height = height;
+		header.tileSize = tileSize;
+		header.levels = uint32_t(mips.size());
+
+		std::ofstream file(outputPath, std::ios::binary);
+		if (!file) {
+			std::cout << "Could not open " << outputPath << " for writing!" << std::endl;
+			return false;
+		}
+
+		// Tiles are stored back to back right after the table
+		const size_t tileBytes = size_t(tileSize) * tileSize * channels;
+		uint64_t tileCount = 0;
+		for (uint32_t level = 0; level < header.levels; level++) {
+			uint32_t tilesX = (max(width >> level, 1u) + tileSize - 1) / tileSize;
+			uint32_t tilesY = (max(height >> level, 1u) + tileSize - 1) / tileSize;
+			tileCount += uint64_t(tilesX) * tilesY;
+		}
+
+		std::vector<uint64_t> offsets(tileCount);
+		uint64_t dataOffset = sizeof(header) + tileCount * sizeof(uint64_t);
+		for (uint64_t i = 0; i < tileCount; i++) offsets[i] = dataOffset + i * tileBytes;
+
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)offsets.data(), offsets.size() * sizeof(uint64_t));
+
+		std::vector<uint8_t> tile(tileBytes);
+		for (uint32_t level = 0; level < header.levels; level++) {
+			const uint32_t levelWidth = max(width >> level, 1u), levelHeight = max(height >> level, 1u);
+			const uint32_t tilesX = (levelWidth + tileSize - 1) / tileSize;
+			const uint32_t tilesY = (levelHeight + tileSize - 1) / tileSize;
+
+			for (uint32_t tileY = 0; tileY < tilesY; tileY++) {
+				for (uint32_t tileX = 0; tileX < tilesX; tileX++) {
+					for (uint32_t y = 0; y < tileSize; y++) {
+						for (uint32_t x = 0; x < tileSize; x++) {
+							uint32_t sourceX = min(tileX * tileSize + x, levelWidth - 1);
+							uint32_t sourceY = min(tileY * tileSize + y, levelHeight - 1);
+							memcpy(
+								&tile[(y * tileSize + x) * channels],
+								&mips[level][(size_t(sourceY) * levelWidth + sourceX) * channels],
+								channels
+							);
+						}
+					}
+
+					file.write((const char*)tile.data(), tile.size());
+				}
+			}
+		}
+
+		return bool(file);
+	}
+
+  private:
+	struct DecodeTable {
+		float values[256];
+
+		DecodeTable() {
+			for (int i = 0; i < 256; i++) values[i] = powf(float(i) / 255.0f, gamma);
+		}
+	};
+
+	int fd = -1;
+	TextureHeader header = TextureHeader();
+	std::vector<uint64_t> offsets;
+	std::vector<uint64_t> levelFirstTile;
+
+	static uint64_t nextId() {
+		static std::atomic<uint64_t> counter(0);
+		return counter++;
+	}
+
+	static bool readPPM(const std::string& path, uint32_t& width, uint32_t& height, std::vector<uint8_t>& image) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file) return false;
+
+		// Header fields are separated by whitespace and may be interleaved with '#' comments
+		std::string fields[4];
+		for (std::string& field : fields) {
+			while (file >> field && field[0] == '#') file.ignore(1 << 16, '\n');
+			if (!file) return false;
+		}
+
+		if (fields[0] != "P6" || fields[3] != "255") return false;
+		if (!parseSize(fields[1], width) || !parseSize(fields[2], height)) return false;
+
+		// A single whitespace character separates the header from the texels
+		file.get();
+
+		// Make sure the file actually holds the texels before allocating room for them
+		const std::streamoff start = file.tellg();
+		file.seekg(0, std::ios::end);
+		const std::streamoff end = file.tellg();
+		const uint64_t bytes = uint64_t(width) * height * channels;
+		if (start < 0 || end < start || uint64_t(end - start) < bytes) return false;
+		file.seekg(start);
+
+		image.resize(size_t(bytes));
+		return bool(file.read((char*)image.data(), image.size()));
+	}
+
+	// Accepts a decimal size in the range [1 to maxSize]
+	static bool parseSize(const std::string& field, uint32_t& size) {
+		if (field.empty() || field.size() > 10 || field.find_first_not_of("0123456789") != std::string::npos) {
+			return false;
+		}
+
+		const unsigned long value = strtoul(field.c_str(), nullptr, 10);
+		if (value == 0 || value > maxSize) return false;
+
+		size = uint32_t(value);
+		return true;
+	}
+
+	static std::vector<float> downsample(const std::vector<float>& source, uint32_t width, uint32_t height) {
+		const uint32_t targetWidth = max(width / 2, 1u), targetHeight = max(height / 2, 1u);
+		std::vector<float> target(size_t(targetWidth) * targetHeight * channels);
+
+		for (uint32_t y = 0; y < targetHeight; y++) {
+			for (uint32_t x = 0; x < targetWidth; x++) {
+				const uint32_t x0 = min(x * 2, width - 1), x1 = min(x * 2 + 1, width - 1);
+				const uint32_t y0 = min(y * 2, height - 1), y1 = min(y * 2 + 1, height - 1);
+
+				for (uint32_t channel = 0; channel < channels; channel++) {
+					float sum = source[(size_t(y0) * width + x0) * channels + channel] +
+								   source[(size_t(y0) * width + x1) * channels + channel] +
+								   source[(size_t(y1) * width + x0) * channels + channel] +
+								   source[(size_t(y1) * width + x1) * channels + channel];
+					target[(size_t(y) * targetWidth + x) * channels + channel] = sum * 0.25f;
+				}
+			}
+		}
+
+		return target;
+	}
+};
+
+struct TextureCacheStats {
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t evictions = 0;
+	size_t residentBytes = 0;
+	size_t budgetBytes = 0;
+
+	float hitRate() const {
+		return hits + misses > 0 ? float(hits) / float(hits + misses) : 0.0f;
+	}
+};
+
+// Thread-safe LRU cache of texture tiles, bounded by a fixed memory budget
+// Tiles live in slots that are recycled in place, indexed by an open addressed table and linked in LRU order by
+// index, so once the cache has warmed up a miss never touches the heap
+// Tiles are read from disk outside of the lock, so a miss only blocks the thread that caused it
+class TextureCache {
+  public:
+	explicit TextureCache(size_t budgetBytes = 64 * 1024 * 1024) {
+		counters.budgetBytes = budgetBytes;
+
+		std::lock_guard<std::mutex> lock(registry().mutex);
+		registry().caches.push_back(this);
+	}
+
+	~TextureCache() {
+		std::lock_guard<std::mutex> lock(registry().mutex);
+		std::vector<TextureCache*>& caches = registry().caches;
+		for (size_t i = 0; i < caches.size(); i++) {
+			if (caches[i] == this) {
+				caches[i] = caches.back();
+				caches.pop_back();
+				break;
+			}
+		}
+	}
+
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	void setBudget(size_t budgetBytes) {
+		std::lock_guard<std::mutex> lock(mutex);
+		counters.budgetBytes = budgetBytes;
+		trim();
+	}
+
+	TextureCacheStats stats() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return counters;
+	}
+
+	// Bilinearly filtered lookup, footprint is the size of the sampled area in level 0 texels
+	// Texels are decoded before they are blended, so the result is in linear space
+	// The U coordinate wraps around, the V coordinate is clamped
+	Color sample(const TiledTexture& texture, float u, float v, float footprint) {
+		const float lod = min(log2f(max(footprint, 1.0f)), float(texture.levels() - 1));
+		const uint32_t level = uint32_t(lod + 0.5f);
+		const int width = int(texture.width(level)), height = int(texture.height(level));
+		const uint32_t tileSize = texture.tileSize();
+
+		const float x = (u - floorf(u)) * float(width) - 0.5f;
+		const float y = clamp(v, 0.0f, 1.0f) * float(height) - 0.5f;
+		const int x0 = int(floorf(x)), y0 = int(floorf(y));
+		const float fx = x - float(x0), fy = y - float(y0);
+
+		// The 2x2 footprint almost always falls in a single tile, so the tile is only looked up again when a
+		// texel crosses into another one. The lock is held throughout, tile pointers are only valid under it
+		const float* decode = TiledTexture::decodeTable();
+		float texels[4][TiledTexture::channels];
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			const uint8_t* tile = nullptr;
+			uint32_t tileX = 0, tileY = 0;
+
+			for (int i = 0; i < 4; i++) {
+				const uint32_t texelX = uint32_t(((x0 + (i & 1)) % width + width) % width);
+				const uint32_t texelY = uint32_t(clamp(y0 + (i >> 1), 0, height - 1));
+
+				if (tile == nullptr || texelX / tileSize != tileX || texelY / tileSize != tileY) {
+					tileX = texelX / tileSize;
+					tileY = texelY / tileSize;
+					tile = acquireTile(lock, texture, level, tileX, tileY);
+				}
+
+				const size_t offset = (size_t(texelY % tileSize) * tileSize + texelX % tileSize) * TiledTexture::channels;
+				for (uint32_t channel = 0; channel < TiledTexture::channels; channel++) {
+					texels[i][channel] = tile != nullptr ? decode[tile[offset + channel]] : 0.0f;
+				}
+			}
+		}
+
+		float rgb[TiledTexture::channels];
+		for (uint32_t channel = 0; channel < TiledTexture::channels; channel++) {
+			float top = texels[0][channel] * (1.0f - fx) + texels[1][channel] * fx;
+			float bottom = texels[2][channel] * (1.0f - fx) + texels[3][channel] * fx;
+			rgb[channel] = top * (1.0f - fy) + bottom * fy;
+		}
+
+		return Color(rgb[0], rgb[1], rgb[2]);
+	}
+
+	// Drops every tile of a texture from every live cache, called when the texture is destroyed
+	static void releaseTexture(uint64_t textureId) {
+		std::lock_guard<std::mutex> registryLock(registry().mutex);
+		for (TextureCache* cache : registry().caches) cache->release(textureId);
+	}
+
+  private:
+	// An enumerator, so it can be bound to references without an out of class definition
+	enum : int32_t { none = -1 };
+
+	struct TileKey {
+		uint64_t texture;
+		// Level, tile Y and tile X, packed as 5, 20 and 20 bits
+		uint64_t tile;
+
+		bool operator==(const TileKey& other) const {
+			return texture == other.texture && tile == other.tile;
+		}
+	};
+
+	struct Slot {
+		TileKey key;
+		bool isOccupied = false;
+		int32_t previous = none;
+		int32_t next = none;
+		std::vector<uint8_t> data;
+	};
+
+	struct Registry {
+		std::mutex mutex;
+		std::vector<TextureCache*> caches;
+	};
+
+	std::mutex mutex;
+	std::vector<Slot> slots;
+	std::vector<int32_t> freeSlots;
+	// Open addressed with linear probing, holds slot indices and is kept at most half full
+	std::vector<int32_t> table;
+	// Most recently used at the head
+	int32_t head = none;
+	int32_t tail = none;
+	TextureCacheStats counters;
+
+	static Registry& registry() {
+		static Registry instance;
+		return instance;
+	}
+
+	static TileKey makeKey(const TiledTexture& texture, uint32_t level, uint32_t tileX, uint32_t tileY) {
+		return TileKey { texture.id, (uint64_t(level) << 40) | (uint64_t(tileY) << 20) | uint64_t(tileX) };
+	}
+
+	static size_t hash(const TileKey& key) {
+		uint64_t h = key.texture * 0x9e3779b97f4a7c15ull ^ key.tile;
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdull;
+		h ^= h >> 33;
+
+		return size_t(h);
+	}
+
+	// Returns the tile's texels, loading it on a miss. The lock is released while reading from disk, so any
+	// pointer previously returned must not be used after calling this again
+	const uint8_t* acquireTile(
+		std::unique_lock<std::mutex>& lock, const TiledTexture& texture, uint32_t level, uint32_t tileX, uint32_t tileY
+	) {
+		const TileKey key = makeKey(texture, level, tileX, tileY);
+
+		int32_t slot = find(key);
+		if (slot != none) {
+			counters.hits++;
+			touch(slot);
+			return slots[slot].data.data();
+		}
+
+		counters.misses++;
+
+		// Each thread keeps its own scratch tile, so reading from disk needs neither the lock nor the heap
+		static thread_local std::vector<uint8_t> scratch;
+		scratch.resize(texture.tileBytes());
+
+		lock.unlock();
+		bool isRead = texture.readTile(level, tileX, tileY, scratch.data());
+		lock.lock();
+		if (!isRead) return nullptr;
+
+		// Another thread may have loaded the same tile in the meantime
+		slot = find(key);
+		if (slot != none) {
+			touch(slot);
+			return slots[slot].data.data();
+		}
+
+		slot = takeSlot(scratch.size());
+		Slot& entry = slots[slot];
+		entry.key = key;
+		entry.isOccupied = true;
+		memcpy(entry.data.data(), scratch.data(), scratch.size());
+
+		insert(slot);
+		linkFront(slot);
+		trim();
+
+		return slots[slot].data.data();
+	}
+
+	// Picks a free slot, a new one while under budget, or recycles the least recently used one
+	int32_t takeSlot(size_t bytes) {
+		int32_t slot;
+		if (!freeSlots.empty()) {
+			slot = freeSlots.back();
+			freeSlots.pop_back();
+		} else if (tail == none || counters.residentBytes + bytes <= counters.budgetBytes) {
+			slot = int32_t(slots.size());
+			slots.push_back(Slot());
+			if (slots.size() * 2 > table.size()) rehash(max(table.size() * 2, size_t(64)));
+		} else {
+			slot = tail;
+			evict(slot);
+		}
+
+		// Reuses the slot's buffer as is when it is large enough, which is always the case for equal tile sizes
+		std::vector<uint8_t>& data = slots[slot].data;
+		if (data.capacity() < bytes) {
+			counters.residentBytes -= data.capacity();
+			data.reserve(bytes);
+			counters.residentBytes += data.capacity();
+		}
+		data.resize(bytes);
+
+		return slot;
+	}
+
+	// Unindexes the slot and unlinks it from the LRU list, keeping its buffer for reuse
+	void evict(int32_t slot) {
+		erase(slot);
+		unlink(slot);
+		slots[slot].isOccupied = false;
+		counters.evictions++;
+	}
+
+	// Releases buffers until the resident bytes fit the budget again, starting with the free slots, then the
+	// least recently used tiles. The most recently used tile is always kept
+	void trim() {
+		for (size_t i = 0; i < freeSlots.size() && counters.residentBytes > counters.budgetBytes; i++) {
+			releaseBuffer(freeSlots[i]);
+		}
+
+		while (counters.residentBytes > counters.budgetBytes && tail != none && tail != head) {
+			int32_t slot = tail;
+			evict(slot);
+			releaseBuffer(slot);
+			freeSlots.push_back(slot);
+		}
+	}
+
+	void releaseBuffer(int32_t slot) {
+		counters.residentBytes -= slots[slot].data.capacity();
+		std::vector<uint8_t>().swap(slots[slot].data);
+	}
+
+	void release(uint64_t textureId) {
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t i = 0; i < slots.size(); i++) {
+			if (!slots[i].isOccupied || slots[i].key.texture != textureId) continue;
+
+			erase(int32_t(i));
+			unlink(int32_t(i));
+			slots[i].isOccupied = false;
+			releaseBuffer(int32_t(i));
+			freeSlots.push_back(int32_t(i));
+		}
+	}
+
+#pragma region LRU list
+	void linkFront(int32_t slot) {
+		slots[slot].previous = none;
+		slots[slot].next = head;
+		if (head != none) slots[head].previous = slot;
+		head = slot;
+		if (tail == none) tail = slot;
+	}
+
+	void unlink(int32_t slot) {
+		Slot& entry = slots[slot];
+		if (entry.previous != none) slots[entry.previous].next = entry.next;
+		else head = entry.next;
+		if (entry.next != none) slots[entry.next].previous = entry.previous;
+		else tail = entry.previous;
+
+		entry.previous = entry.next = none;
+	}
+
+	void touch(int32_t slot) {
+		if (slot == head) return;
+		unlink(slot);
+		linkFront(slot);
+	}
+#pragma endregion LRU list
+
+#pragma region Index
+	int32_t find(const TileKey& key) const {
+		if (table.empty()) return none;
+
+		const size_t mask = table.size() - 1;
+		for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+			if (table[i] == none) return none;
+			if (slots[table[i]].key == key) return table[i];
+		}
+	}
+
+	void insert(int32_t slot) {
+		const size_t mask = table.size() - 1;
+		size_t i = hash(slots[slot].key) & mask;
+		while (table[i] != none) i = (i + 1) & mask;
+		table[i] = slot;
+	}
+
+	// Backward shift deletion, so no tombstones are left behind
+	void erase(int32_t slot) {
+		const size_t mask = table.size() - 1;
+		size_t i = hash(slots[slot].key) & mask;
+		while (table[i] != slot) i = (i + 1) & mask;
+
+		for (size_t j = (i + 1) & mask; table[j] != none; j = (j + 1) & mask) {
+			// Move the entry back when its home bucket doesn't lie cyclically within (i, j]
+			size_t home = hash(slots[table[j]].key) & mask;
+			if (((j - home) & mask) >= ((j - i) & mask)) {
+				table[i] = table[j];
+				i = j;
+			}
+		}
+
+		table[i] = none;
+	}
+
+	void rehash(size_t size) {
+		table.assign(size, none);
+		for (size_t i = 0; i < slots.size(); i++) {
+			if (slots[i].isOccupied) insert(int32_t(i));
+		}
+	}
+#pragma endregion Index
+};
+
+inline TiledTexture::~TiledTexture() {
+	TextureCache::releaseTexture(id);
+	if (fd >= 0) close(fd);
+}
@@ -2,6 +2,9 @@
 #include "camera.hpp"
 #include "sphere.hpp"
 #include "vector.hpp"
+#include <fstream>
+#include <sstream>
+#include <string>
 #include <vector>
 
 class World {
@@ -23,4 +26,47 @@ class World {
         spheres.push_back(Sphere(Vector3(1, -1, -1), 0.25f, Color(0.0f, 0.0f, 1.0f)));
     }
 
+    // Replaces the scene with the one described in a text file, one entry per line:
+    //   camera <x> <y> <z>
+    //   light <x> <y> <z>
+    //   sphere <x> <y> <z> <radius> <red> <green> <blue> [texture.rtex]
+    // Empty lines and lines starting with '#' are ignored
+    bool loadFromFile(const std::string& path) {
+        std::ifstream file(path);
+        if (!file) return false;
+
+        spheres.clear();
+
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream stream(line);
+            std::string type;
+            if (!(stream >> type) || type[0] == '#') continue;
+
+            if (type == "camera") {
+                if (!(stream >> camera.origin.x >> camera.origin.y >> camera.origin.z)) return false;
+            } else if (type == "light") {
+                Vector3 direction;
+                if (!(stream >> direction.x >> direction.y >> direction.z)) return false;
+                light = Vector3::normalize(direction);
+            } else if (type == "sphere") {
+                Vector3 position;
+                float radius, red, green, blue;
+                if (!(stream >> position.x >> position.y >> position.z >> radius >> red >> green >> blue)) return false;
+                spheres.push_back(Sphere(position, radius, Color(red, green, blue)));
+
+                std::string texturePath;
+                if (stream >> texturePath) {
+                    std::shared_ptr<TiledTexture> texture(new TiledTexture());
+                    if (!texture->open(texturePath)) return false;
+                    spheres.back().texture = texture;
+                }
+            } else {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
 };
\ No newline at end of file